@@ -0,0 +1,44 @@
+// Helpers shared by the benchmarks. Each benchmark includes hash_map.h with the implementation, so this header only has
+// static helpers.
+#ifndef C_FEK_HASH_MAP_BENCH_H
+#define C_FEK_HASH_MAP_BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Monotonic time, in nanoseconds
+static inline long long bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+static inline int bench_int_compare(const void *key1, const void *key2) {
+    return *(const int *)key1 == *(const int *)key2;
+}
+
+// Multiplicative hash, so sequential keys spread over the table
+static inline unsigned int bench_int_hash(const void *key) {
+    return (unsigned int)*(const int *)key * 2654435761u;
+}
+
+// Hashes groups of 8 consecutive keys to the same value, to build clusters
+static inline unsigned int bench_clustered_int_hash(const void *key) {
+    return ((unsigned int)*(const int *)key >> 3) * 2654435761u;
+}
+
+// splitmix64
+static inline unsigned long long bench_random(unsigned long long *state) {
+    unsigned long long z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// Gets the integer argument at 'index', or 'default_value' if there are not that many arguments
+static inline long long bench_arg(int argc, char **argv, int index, long long default_value) {
+    return index < argc ? atoll(argv[index]) : default_value;
+}
+
+#endif
@@ -0,0 +1,1381 @@
+// Sanity checks of the hash maps, so a broken map does not get benchmarked.
+//
+// For several initial capacities, from empty to large ones (where the first puts already land in the last buckets), every
+// map gets twice as many keys as its initial capacity, so it also grows. All keys are then looked up, half of them are
+// deleted, the rest are checked, counted and iterated (except in the direct-addressed map, which has no iterator), and the
+// deleted ones are put back. Both a good hash function and one that makes clusters of 8 keys are checked (the latter
+// except with the cuckoo map).
+// The other features are then checked against known results: the string interner, composite keys, learned placement, the
+// set operations, cloning, fingerprints and digests, bulk loading, snapshots, compact snapshots, mapped snapshots and NUMA
+// replicas.
+// Prints the failed checks and returns 1 if any failed. Some checks write the file CHECK_FILE to the current directory, and
+// delete it when done.
+//
+// Usage: check [max_initial_capacity]
+
+#define C_FEK_HASH_MAP_IMPLEMENT
+#include "../hash_map.h"
+#include "bench.h"
+
+typedef enum {
+    MAP_LINEAR_PROBING,
+    MAP_TRIANGULAR_PROBING,
+    MAP_LINEAR_HASHING,
+    MAP_ADAPTIVE,
+    MAP_DIRECT,
+    MAP_CUCKOO,
+    MAP_HOPSCOTCH,
+    MAP_OVERLAY,
+    NUM_MAP_TYPES
+} Map_Type;
+
+static const char *map_type_names[NUM_MAP_TYPES] = {"linear probing", "triangular probing", "linear hashing", "adaptive",
+                                                    "direct", "cuckoo", "hopscotch", "overlay"};
+
+// Every kind of map, so the checks below are written once
+typedef struct {
+    Map_Type type;
+    Hash_Map hm;
+    Hash_Map_Linear hml;
+    Hash_Map_Adaptive hma;
+    Hash_Map_Direct hmd;
+    Hash_Map_Cuckoo hmc;
+    Hash_Map_Hopscotch hmh;
+    // The overlay is over 'base', and is merged into 'merged' to be counted and iterated
+    Hash_Map base;
+    Hash_Map_Overlay hmo;
+    Hash_Map merged;
+    int has_merged;
+} Map;
+
+// The value stored for each key
+static int value_of(int key) {
+    return key * 3 + 1;
+}
+
+// Creates the base of an overlay with the multiples of 3 up to the number of keys of 'check_map', with other values, so some
+// puts and deletes of the overlay are over elements of the base and others are not
+static int overlay_create(Map *map, int initial_capacity, Key_Hash_Func key_hash_func) {
+    if (hash_map_create(&map->base, 0, sizeof(int), sizeof(int), bench_int_compare, key_hash_func)) {
+        return -1;
+    }
+    for (int key = 0; key < initial_capacity * 2 + 100; key += 3) {
+        int value = -value_of(key);
+        if (hash_map_put(&map->base, &key, &value)) {
+            hash_map_destroy(&map->base);
+            return -1;
+        }
+    }
+    map->has_merged = 0;
+    if (hash_map_overlay_create(&map->hmo, &map->base, initial_capacity)) {
+        hash_map_destroy(&map->base);
+        return -1;
+    }
+    return 0;
+}
+
+// Merges the overlay into 'map->merged', replacing the previous merge
+static int overlay_merge(Map *map) {
+    if (map->has_merged) {
+        hash_map_destroy(&map->merged);
+    }
+    map->has_merged = !hash_map_overlay_merge(&map->hmo, &map->merged);
+    return map->has_merged ? 0 : -1;
+}
+
+static int map_create(Map *map, Map_Type type, int initial_capacity, Key_Hash_Func key_hash_func) {
+    map->type = type;
+    switch (type) {
+        case MAP_LINEAR_HASHING:
+            return hash_map_linear_create(&map->hml, initial_capacity, sizeof(int), sizeof(int), bench_int_compare,
+                                          key_hash_func);
+        case MAP_ADAPTIVE:
+            // The initial capacity is used as the threshold (0 is the default one), up to a size that still scans quickly
+            return hash_map_adaptive_create(&map->hma, initial_capacity < 64 ? initial_capacity : 64, sizeof(int), sizeof(int),
+                                            bench_int_compare, key_hash_func);
+        case MAP_DIRECT:
+            // Only the keys up to the initial capacity are in the range, the others go to the fallback hash map
+            return hash_map_direct_create(&map->hmd, 0, initial_capacity + 1, sizeof(int), sizeof(int), initial_capacity,
+                                          key_hash_func);
+        case MAP_CUCKOO:
+            return hash_map_cuckoo_create(&map->hmc, initial_capacity, sizeof(int), sizeof(int), bench_int_compare,
+                                          key_hash_func);
+        case MAP_HOPSCOTCH:
+            return hash_map_hopscotch_create(&map->hmh, initial_capacity, sizeof(int), sizeof(int), bench_int_compare,
+                                             key_hash_func);
+        case MAP_OVERLAY:
+            return overlay_create(map, initial_capacity, key_hash_func);
+        default:
+            return hash_map_create_with_probing(
+                &map->hm, initial_capacity, sizeof(int), sizeof(int), bench_int_compare, key_hash_func,
+                type == MAP_TRIANGULAR_PROBING ? HASH_MAP_PROBING_TRIANGULAR : HASH_MAP_PROBING_LINEAR);
+    }
+}
+
+static int map_put(Map *map, int key, int value) {
+    switch (map->type) {
+        case MAP_LINEAR_HASHING:
+            return hash_map_linear_put(&map->hml, &key, &value);
+        case MAP_ADAPTIVE:
+            return hash_map_adaptive_put(&map->hma, &key, &value);
+        case MAP_DIRECT:
+            return hash_map_direct_put(&map->hmd, &key, &value);
+        case MAP_CUCKOO:
+            return hash_map_cuckoo_put(&map->hmc, &key, &value);
+        case MAP_HOPSCOTCH:
+            return hash_map_hopscotch_put(&map->hmh, &key, &value);
+        case MAP_OVERLAY:
+            return hash_map_overlay_put(&map->hmo, &key, &value);
+        default:
+            return hash_map_put(&map->hm, &key, &value);
+    }
+}
+
+static int map_get(Map *map, int key, int *value) {
+    switch (map->type) {
+        case MAP_LINEAR_HASHING:
+            return hash_map_linear_get(&map->hml, &key, value);
+        case MAP_ADAPTIVE:
+            return hash_map_adaptive_get(&map->hma, &key, value);
+        case MAP_DIRECT:
+            return hash_map_direct_get(&map->hmd, &key, value);
+        case MAP_CUCKOO:
+            return hash_map_cuckoo_get(&map->hmc, &key, value);
+        case MAP_HOPSCOTCH:
+            return hash_map_hopscotch_get(&map->hmh, &key, value);
+        case MAP_OVERLAY:
+            return hash_map_overlay_get(&map->hmo, &key, value);
+        default:
+            return hash_map_get(&map->hm, &key, value);
+    }
+}
+
+static int map_delete(Map *map, int key) {
+    switch (map->type) {
+        case MAP_LINEAR_HASHING:
+            return hash_map_linear_delete(&map->hml, &key);
+        case MAP_ADAPTIVE:
+            return hash_map_adaptive_delete(&map->hma, &key);
+        case MAP_DIRECT:
+            return hash_map_direct_delete(&map->hmd, &key);
+        case MAP_CUCKOO:
+            return hash_map_cuckoo_delete(&map->hmc, &key);
+        case MAP_HOPSCOTCH:
+            return hash_map_hopscotch_delete(&map->hmh, &key);
+        case MAP_OVERLAY:
+            return hash_map_overlay_delete(&map->hmo, &key);
+        default:
+            return hash_map_delete(&map->hm, &key);
+    }
+}
+
+static int map_num_elements(Map *map) {
+    switch (map->type) {
+        case MAP_LINEAR_HASHING:
+            return map->hml.num_elements;
+        case MAP_ADAPTIVE:
+            return hash_map_adaptive_num_elements(&map->hma);
+        case MAP_DIRECT:
+            return hash_map_direct_num_elements(&map->hmd);
+        case MAP_CUCKOO:
+            return map->hmc.num_elements;
+        case MAP_HOPSCOTCH:
+            return map->hmh.num_elements;
+        case MAP_OVERLAY:
+            return overlay_merge(map) ? -1 : map->merged.num_elements;
+        default:
+            return map->hm.num_elements;
+    }
+}
+
+// The direct-addressed map has no iterator
+static Hash_Map_Iterator map_iterator_next(Map *map, Hash_Map_Iterator iterator, int *key, int *value) {
+    switch (map->type) {
+        case MAP_LINEAR_HASHING:
+            return hash_map_linear_iterator_next(&map->hml, iterator, key, value);
+        case MAP_ADAPTIVE:
+            return hash_map_adaptive_iterator_next(&map->hma, iterator, key, value);
+        case MAP_CUCKOO:
+            return hash_map_cuckoo_iterator_next(&map->hmc, iterator, key, value);
+        case MAP_HOPSCOTCH:
+            return hash_map_hopscotch_iterator_next(&map->hmh, iterator, key, value);
+        case MAP_OVERLAY:
+            return hash_map_iterator_next(&map->merged, iterator, key, value);
+        default:
+            return hash_map_iterator_next(&map->hm, iterator, key, value);
+    }
+}
+
+static Hash_Map_Iterator map_get_iterator(Map *map) {
+    switch (map->type) {
+        case MAP_LINEAR_HASHING:
+            return hash_map_linear_get_iterator(&map->hml);
+        case MAP_ADAPTIVE:
+            return hash_map_adaptive_get_iterator(&map->hma);
+        case MAP_CUCKOO:
+            return hash_map_cuckoo_get_iterator(&map->hmc);
+        case MAP_HOPSCOTCH:
+            return hash_map_hopscotch_get_iterator(&map->hmh);
+        case MAP_OVERLAY:
+            return overlay_merge(map) ? HASH_MAP_ITERATOR_END : hash_map_get_iterator(&map->merged);
+        default:
+            return hash_map_get_iterator(&map->hm);
+    }
+}
+
+static void map_destroy(Map *map) {
+    switch (map->type) {
+        case MAP_LINEAR_HASHING:
+            hash_map_linear_destroy(&map->hml);
+            break;
+        case MAP_ADAPTIVE:
+            hash_map_adaptive_destroy(&map->hma);
+            break;
+        case MAP_DIRECT:
+            hash_map_direct_destroy(&map->hmd);
+            break;
+        case MAP_CUCKOO:
+            hash_map_cuckoo_destroy(&map->hmc);
+            break;
+        case MAP_HOPSCOTCH:
+            hash_map_hopscotch_destroy(&map->hmh);
+            break;
+        case MAP_OVERLAY:
+            hash_map_overlay_destroy(&map->hmo);
+            hash_map_destroy(&map->base);
+            if (map->has_merged) {
+                hash_map_destroy(&map->merged);
+            }
+            break;
+        default:
+            hash_map_destroy(&map->hm);
+            break;
+    }
+}
+
+// Returns the number of failed checks
+static int check_map(Map_Type type, int initial_capacity, Key_Hash_Func key_hash_func) {
+    Map map;
+    int num_keys = initial_capacity * 2 + 100;
+    int num_failed = 0;
+    int value;
+    if (map_create(&map, type, initial_capacity, key_hash_func)) {
+        printf("  create failed\n");
+        return 1;
+    }
+    for (int key = 0; key < num_keys; ++key) {
+        if (map_put(&map, key, value_of(key))) {
+            printf("  put %d failed\n", key);
+            ++num_failed;
+        }
+    }
+    for (int key = 0; key < num_keys; ++key) {
+        if (map_get(&map, key, &value) || value != value_of(key)) {
+            printf("  get %d failed\n", key);
+            ++num_failed;
+        }
+    }
+    if (!map_get(&map, num_keys, &value)) {
+        printf("  get %d found a key that was never put\n", num_keys);
+        ++num_failed;
+    }
+
+    // Delete the even keys
+    for (int key = 0; key < num_keys; key += 2) {
+        if (map_delete(&map, key)) {
+            printf("  delete %d failed\n", key);
+            ++num_failed;
+        }
+    }
+    for (int key = 0; key < num_keys; ++key) {
+        int found = !map_get(&map, key, &value);
+        if (found != (key % 2) || (found && value != value_of(key))) {
+            printf("  get %d after the deletes failed\n", key);
+            ++num_failed;
+        }
+    }
+
+    if (map_num_elements(&map) != num_keys / 2) {
+        printf("  the map has %d elements, expected %d\n", map_num_elements(&map), num_keys / 2);
+        ++num_failed;
+    }
+
+    // Iterate, expecting every odd key once
+    if (type != MAP_DIRECT) {
+        unsigned char *seen = (unsigned char *)calloc(num_keys, 1);
+        int num_iterated = 0;
+        int key;
+        Hash_Map_Iterator iterator = map_get_iterator(&map);
+        while ((iterator = map_iterator_next(&map, iterator, &key, &value)) != HASH_MAP_ITERATOR_END) {
+            if (key < 0 || key >= num_keys || key % 2 == 0 || seen[key] || value != value_of(key)) {
+                printf("  iterator returned an unexpected key %d\n", key);
+                ++num_failed;
+            } else {
+                seen[key] = 1;
+            }
+            ++num_iterated;
+        }
+        if (num_iterated != num_keys / 2) {
+            printf("  iterator returned %d elements, expected %d\n", num_iterated, num_keys / 2);
+            ++num_failed;
+        }
+        free(seen);
+    }
+
+    // Put the deleted keys back
+    for (int key = 0; key < num_keys; key += 2) {
+        if (map_put(&map, key, value_of(key))) {
+            printf("  put %d after the deletes failed\n", key);
+            ++num_failed;
+        }
+    }
+    for (int key = 0; key < num_keys; ++key) {
+        if (map_get(&map, key, &value) || value != value_of(key)) {
+            printf("  get %d after putting back failed\n", key);
+            ++num_failed;
+        }
+    }
+    map_destroy(&map);
+    return num_failed;
+}
+
+// Number of elements used by the checks of the other features
+#define NUM_FEATURE_ELEMENTS 100000
+#define CHECK_FILE "check.tmp"
+
+// Interns distinct strings one by one and then again in a batch, expecting dense ids in insertion order, and finds them by
+// string and by id
+static int check_interner(void) {
+    Hash_Map_Interner hmi;
+    int num_failed = 0;
+    unsigned int id;
+    if (hash_map_interner_create(&hmi, 0)) {
+        printf("  create failed\n");
+        return 1;
+    }
+    char(*strs)[16] = (char(*)[16])calloc(NUM_FEATURE_ELEMENTS, 16);
+    const char **str_pointers = (const char **)calloc(NUM_FEATURE_ELEMENTS, sizeof(char *));
+    unsigned int *ids = (unsigned int *)calloc(NUM_FEATURE_ELEMENTS, sizeof(unsigned int));
+    for (int i = 0; i < NUM_FEATURE_ELEMENTS; ++i) {
+        int length = snprintf(strs[i], 16, "string %d", i);
+        str_pointers[i] = strs[i];
+        if (hash_map_interner_intern(&hmi, strs[i], length, &id) || id != (unsigned int)i) {
+            printf("  intern \"%s\" failed\n", strs[i]);
+            ++num_failed;
+        }
+    }
+    if (hash_map_interner_intern_batch(&hmi, str_pointers, 0, NUM_FEATURE_ELEMENTS, ids)) {
+        printf("  intern batch failed\n");
+        ++num_failed;
+    }
+    for (int i = 0; i < NUM_FEATURE_ELEMENTS; ++i) {
+        int length = -1;
+        const char *str = hash_map_interner_lookup(&hmi, (unsigned int)i, &length);
+        if (ids[i] != (unsigned int)i || hash_map_interner_find(&hmi, strs[i], (int)strlen(strs[i]), &id) ||
+            id != (unsigned int)i || !str || length != (int)strlen(strs[i]) || strcmp(str, strs[i])) {
+            printf("  string %d was not interned once\n", i);
+            ++num_failed;
+        }
+    }
+    // A prefix is a different string
+    if (!hash_map_interner_find(&hmi, "string 1", 7, &id) ||
+        hash_map_interner_intern(&hmi, "string 1", 7, &id) || id != NUM_FEATURE_ELEMENTS ||
+        hash_map_interner_lookup(&hmi, NUM_FEATURE_ELEMENTS + 1, 0)) {
+        printf("  prefix or missing string failed\n");
+        ++num_failed;
+    }
+    free(strs);
+    free(str_pointers);
+    free(ids);
+    hash_map_interner_destroy(&hmi);
+    return num_failed;
+}
+
+// (tenant, user, day, name) keys
+static Hash_Map_Key_Schema key_schema;
+
+static int key_schema_compare(const void *key1, const void *key2) {
+    return hash_map_key_schema_compare(&key_schema, key1, key2);
+}
+
+static unsigned int key_schema_hash(const void *key) {
+    return hash_map_key_schema_hash(&key_schema, key);
+}
+
+// Packs the fields of the i-th key, which are also written to 'day' and 'name'
+static void key_schema_pack_key(int i, unsigned char *key, char *day, char *name) {
+    int tenant = i % 7;
+    long long user = (long long)i << 20;
+    snprintf(day, 8, "day %d", i % 30);
+    snprintf(name, 13, "user %d", i);
+    const void *field_values[] = {&tenant, &user, day, name};
+    hash_map_key_schema_pack(&key_schema, key, field_values);
+}
+
+// Puts, gets, deletes and iterates composite keys, reads their fields back, and checks that hashing the columns gives the
+// same hashes as the packed keys
+static int check_key_schema(void) {
+    const Hash_Map_Key_Field fields[] = {
+        {HASH_MAP_KEY_FIELD_INT32, 0},
+        {HASH_MAP_KEY_FIELD_INT64, 0},
+        {HASH_MAP_KEY_FIELD_FIXED_STRING, 8},
+        {HASH_MAP_KEY_FIELD_STRING, 12},
+    };
+    Hash_Map hm;
+    if (hash_map_key_schema_create(&key_schema, fields, 4) ||
+        hash_map_create(&hm, 0, key_schema.key_size, sizeof(int), key_schema_compare, key_schema_hash)) {
+        printf("  create failed\n");
+        return 1;
+    }
+    int num_failed = 0;
+    unsigned char *keys = (unsigned char *)calloc(NUM_FEATURE_ELEMENTS, key_schema.key_size);
+    int *tenants = (int *)calloc(NUM_FEATURE_ELEMENTS, sizeof(int));
+    long long *users = (long long *)calloc(NUM_FEATURE_ELEMENTS, sizeof(long long));
+    char(*days)[8] = (char(*)[8])calloc(NUM_FEATURE_ELEMENTS, 8);
+    char(*names)[13] = (char(*)[13])calloc(NUM_FEATURE_ELEMENTS, 13);
+    const char **name_pointers = (const char **)calloc(NUM_FEATURE_ELEMENTS, sizeof(char *));
+    unsigned int *hashes = (unsigned int *)calloc(NUM_FEATURE_ELEMENTS, sizeof(unsigned int));
+    for (int i = 0; i < NUM_FEATURE_ELEMENTS; ++i) {
+        unsigned char *key = keys + (long long)i * key_schema.key_size;
+        key_schema_pack_key(i, key, days[i], names[i]);
+        tenants[i] = i % 7;
+        users[i] = (long long)i << 20;
+        name_pointers[i] = names[i];
+        int value = value_of(i);
+        if (hash_map_put(&hm, key, &value)) {
+            printf("  put %d failed\n", i);
+            ++num_failed;
+        }
+    }
+    const void *columns[] = {tenants, users, days, name_pointers};
+    hash_map_key_schema_hash_columns(&key_schema, columns, NUM_FEATURE_ELEMENTS, hashes);
+    for (int i = 0; i < NUM_FEATURE_ELEMENTS; ++i) {
+        unsigned char *key = keys + (long long)i * key_schema.key_size;
+        int value, tenant;
+        long long user;
+        char day[8], name[13];
+        hash_map_key_schema_get_field(&key_schema, key, 0, &tenant);
+        hash_map_key_schema_get_field(&key_schema, key, 1, &user);
+        hash_map_key_schema_get_field(&key_schema, key, 2, day);
+        hash_map_key_schema_get_field(&key_schema, key, 3, name);
+        if (tenant != tenants[i] || user != users[i] || memcmp(day, days[i], 8) || strcmp(name, names[i])) {
+            printf("  fields of key %d differ\n", i);
+            ++num_failed;
+        }
+        if (hashes[i] != key_schema_hash(key)) {
+            printf("  column hash of key %d differs\n", i);
+            ++num_failed;
+        }
+        if (hash_map_get(&hm, key, &value) || value != value_of(i)) {
+            printf("  get %d failed\n", i);
+            ++num_failed;
+        }
+    }
+    for (int i = 0; i < NUM_FEATURE_ELEMENTS; i += 2) {
+        if (hash_map_delete(&hm, keys + (long long)i * key_schema.key_size)) {
+            printf("  delete %d failed\n", i);
+            ++num_failed;
+        }
+    }
+    // Only the odd keys are left, each with its own value
+    unsigned char *key = (unsigned char *)calloc(1, key_schema.key_size);
+    int value, num_iterated = 0;
+    Hash_Map_Iterator iterator = hash_map_get_iterator(&hm);
+    while ((iterator = hash_map_iterator_next(&hm, iterator, key, &value)) != HASH_MAP_ITERATOR_END) {
+        int i = (value - 1) / 3;
+        if (value % 3 != 1 || i < 0 || i >= NUM_FEATURE_ELEMENTS || i % 2 == 0 ||
+            memcmp(key, keys + (long long)i * key_schema.key_size, key_schema.key_size)) {
+            printf("  iterator returned an unexpected key\n");
+            ++num_failed;
+        }
+        ++num_iterated;
+    }
+    if (num_iterated != NUM_FEATURE_ELEMENTS / 2) {
+        printf("  iterator returned %d elements, expected %d\n", num_iterated, NUM_FEATURE_ELEMENTS / 2);
+        ++num_failed;
+    }
+    free(key);
+    free(keys);
+    free(tenants);
+    free(users);
+    free(days);
+    free(names);
+    free(name_pointers);
+    free(hashes);
+    hash_map_destroy(&hm);
+    return num_failed;
+}
+
+// Skewed keys, spread more and more apart, such as the ids of a growing system
+static int learned_key(int i) {
+    return i + (int)((long long)i * i / 64);
+}
+
+// Builds a hash map with learned placement, checks that the model was fitted, and then puts keys out of the range of the
+// model, deletes the even keys and iterates the rest
+static int check_learned(void) {
+    Hash_Map hm;
+    int num_failed = 0;
+    int *keys = (int *)calloc(NUM_FEATURE_ELEMENTS, sizeof(int));
+    int *values = (int *)calloc(NUM_FEATURE_ELEMENTS, sizeof(int));
+    for (int i = 0; i < NUM_FEATURE_ELEMENTS; ++i) {
+        keys[i] = learned_key(i);
+        values[i] = value_of(keys[i]);
+    }
+    if (hash_map_build_learned(&hm, keys, values, NUM_FEATURE_ELEMENTS, sizeof(int), sizeof(int), 0, 0)) {
+        printf("  build failed\n");
+        free(keys);
+        free(values);
+        return 1;
+    }
+    if (!hm.learned_model) {
+        printf("  the model was not fitted\n");
+        ++num_failed;
+    }
+    // Keys below and above the range of the model
+    int num_outside = 1000;
+    for (int i = 1; i <= num_outside; ++i) {
+        int below = -i, above = keys[NUM_FEATURE_ELEMENTS - 1] + i;
+        int below_value = value_of(below), above_value = value_of(above);
+        if (hash_map_put(&hm, &below, &below_value) || hash_map_put(&hm, &above, &above_value)) {
+            printf("  put %d or %d failed\n", below, above);
+            ++num_failed;
+        }
+    }
+    for (int i = 0; i < NUM_FEATURE_ELEMENTS; i += 2) {
+        if (hash_map_delete(&hm, &keys[i])) {
+            printf("  delete %d failed\n", keys[i]);
+            ++num_failed;
+        }
+    }
+    for (int i = 0; i < NUM_FEATURE_ELEMENTS; ++i) {
+        int value, missing = keys[i] + 1;
+        int found = !hash_map_get(&hm, &keys[i], &value);
+        if (found != (i % 2) || (found && value != values[i]) ||
+            (i + 1 < NUM_FEATURE_ELEMENTS && missing != keys[i + 1] && !hash_map_get(&hm, &missing, &value))) {
+            printf("  get %d failed\n", keys[i]);
+            ++num_failed;
+        }
+    }
+    int key, value, num_iterated = 0;
+    Hash_Map_Iterator iterator = hash_map_get_iterator(&hm);
+    while ((iterator = hash_map_iterator_next(&hm, iterator, &key, &value)) != HASH_MAP_ITERATOR_END) {
+        if (value != value_of(key)) {
+            printf("  iterator returned an unexpected key %d\n", key);
+            ++num_failed;
+        }
+        ++num_iterated;
+    }
+    if (num_iterated != NUM_FEATURE_ELEMENTS / 2 + 2 * num_outside) {
+        printf("  iterator returned %d elements, expected %d\n", num_iterated, NUM_FEATURE_ELEMENTS / 2 + 2 * num_outside);
+        ++num_failed;
+    }
+    free(keys);
+    free(values);
+    hash_map_destroy(&hm);
+    return num_failed;
+}
+
+// The set operations are checked with 'a', which has the keys [0, NUM_FEATURE_ELEMENTS) with 'value_of' as values, and 'b',
+// which has the keys [NUM_FEATURE_ELEMENTS / 2, NUM_FEATURE_ELEMENTS * 3 / 2) with the keys as values
+static int set_operations_create(Hash_Map *hm, int first_key, int last_key, int values_are_keys, Hash_Map_Probing probing) {
+    if (hash_map_create_with_probing(hm, 0, sizeof(int), sizeof(int), bench_int_compare, bench_int_hash, probing)) {
+        return -1;
+    }
+    for (int key = first_key; key < last_key; ++key) {
+        int value = values_are_keys ? key : value_of(key);
+        if (hash_map_put(hm, &key, &value)) {
+            hash_map_destroy(hm);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void set_operations_add(void *value, const void *other_value) {
+    *(int *)value += *(const int *)other_value;
+}
+
+// The value of a key after an operation: from 'a' if only in 'a', from 'b' if only in 'b', and from 'b' or the sum of both
+// if in both, depending on 'added'
+static int set_operations_value(int key, int added) {
+    if (key < NUM_FEATURE_ELEMENTS / 2) {
+        return value_of(key);
+    }
+    if (key >= NUM_FEATURE_ELEMENTS) {
+        return key;
+    }
+    return added ? value_of(key) + key : key;
+}
+
+// Checks that 'hm' has exactly the keys [first_key, last_key), with the values given by 'set_operations_value', or by
+// 'value_of' if 'values_of_a' is set. Returns the number of failed checks.
+static int set_operations_expect(const char *operation, Hash_Map *hm, int first_key, int last_key, int added, int values_of_a) {
+    int num_failed = 0;
+    for (int key = first_key - 1; key <= last_key; ++key) {
+        int value;
+        int found = !hash_map_get(hm, &key, &value);
+        int expected_value = values_of_a ? value_of(key) : set_operations_value(key, added);
+        if (found != (key >= first_key && key < last_key) || (found && value != expected_value)) {
+            printf("  %s: get %d failed\n", operation, key);
+            ++num_failed;
+        }
+    }
+    if (hm->num_elements != last_key - first_key) {
+        printf("  %s: %d elements, expected %d\n", operation, hm->num_elements, last_key - first_key);
+        ++num_failed;
+    }
+    return num_failed;
+}
+
+// Merges, intersects and subtracts two overlapping hash maps, with and without a merge function, and compares them
+static int check_set_operations(void) {
+    int num_failed = 0;
+    for (int probing = HASH_MAP_PROBING_LINEAR; probing <= HASH_MAP_PROBING_TRIANGULAR; ++probing) {
+        Hash_Map a, b, result, other;
+        if (set_operations_create(&a, 0, NUM_FEATURE_ELEMENTS, 0, (Hash_Map_Probing)probing) ||
+            set_operations_create(&b, NUM_FEATURE_ELEMENTS / 2, NUM_FEATURE_ELEMENTS * 3 / 2, 1, (Hash_Map_Probing)probing)) {
+            printf("  create failed\n");
+            return num_failed + 1;
+        }
+        for (int added = 0; added < 2; ++added) {
+            Value_Merge_Func merge_func = added ? set_operations_add : 0;
+            if (hash_map_clone(&result, &a) || hash_map_merge(&result, &b, merge_func)) {
+                printf("  merge failed\n");
+                ++num_failed;
+            } else {
+                num_failed += set_operations_expect("merge", &result, 0, NUM_FEATURE_ELEMENTS * 3 / 2, added, 0);
+                hash_map_destroy(&result);
+            }
+            if (hash_map_clone(&result, &a) || hash_map_intersect(&result, &b, merge_func)) {
+                printf("  intersect failed\n");
+                ++num_failed;
+            } else {
+                // Without a merge function, the values of 'a' are kept
+                num_failed += set_operations_expect("intersect", &result, NUM_FEATURE_ELEMENTS / 2, NUM_FEATURE_ELEMENTS, added,
+                                                    !added);
+                hash_map_destroy(&result);
+            }
+        }
+        if (hash_map_clone(&result, &a)) {
+            printf("  clone failed\n");
+            ++num_failed;
+        } else {
+            int num_deleted = hash_map_subtract(&result, &b);
+            if (num_deleted != NUM_FEATURE_ELEMENTS / 2) {
+                printf("  subtract deleted %d elements, expected %d\n", num_deleted, NUM_FEATURE_ELEMENTS / 2);
+                ++num_failed;
+            }
+            num_failed += set_operations_expect("subtract", &result, 0, NUM_FEATURE_ELEMENTS / 2, 0, 1);
+            hash_map_destroy(&result);
+        }
+
+        // The same elements in a hash map of another capacity are equal, and any difference makes them different
+        if (set_operations_create(&other, 0, NUM_FEATURE_ELEMENTS, 0, (Hash_Map_Probing)probing) ||
+            hash_map_reserve(&other, NUM_FEATURE_ELEMENTS * 4)) {
+            printf("  create failed\n");
+            ++num_failed;
+        } else {
+            int key = NUM_FEATURE_ELEMENTS / 3, value = 0;
+            int equal = hash_map_equals(&a, &other) && hash_map_equals(&other, &a);
+            hash_map_put(&other, &key, &value);
+            int different_value = !hash_map_equals(&a, &other);
+            hash_map_delete(&other, &key);
+            int different_size = !hash_map_equals(&a, &other) && !hash_map_equals(&other, &a);
+            key = -1;
+            hash_map_put(&other, &key, &value);
+            int different_key = !hash_map_equals(&a, &other) && !hash_map_equals(&other, &a) && !hash_map_equals(&a, &b);
+            if (!equal || !different_value || !different_size || !different_key) {
+                printf("  equals failed\n");
+                ++num_failed;
+            }
+            hash_map_destroy(&other);
+        }
+        hash_map_destroy(&a);
+        hash_map_destroy(&b);
+    }
+    return num_failed;
+}
+
+// Clones a hash map (with and without the fingerprint enabled), and a mostly deleted one compactly, and checks that the
+// clones are equal and independent of the original
+static int check_clone(void) {
+    int num_failed = 0;
+    for (int probing = HASH_MAP_PROBING_LINEAR; probing <= HASH_MAP_PROBING_TRIANGULAR; ++probing) {
+        for (int fingerprint = 0; fingerprint < 2; ++fingerprint) {
+            Hash_Map hm, clone, compact_clone;
+            if (set_operations_create(&hm, 0, NUM_FEATURE_ELEMENTS, 0, (Hash_Map_Probing)probing)) {
+                printf("  create failed\n");
+                return num_failed + 1;
+            }
+            if (fingerprint) {
+                hash_map_enable_fingerprint(&hm);
+            }
+            if (hash_map_clone(&clone, &hm)) {
+                printf("  clone failed\n");
+                ++num_failed;
+            } else {
+                if (clone.capacity != hm.capacity || !hash_map_equals(&clone, &hm) || clone.fingerprint_enabled != fingerprint ||
+                    clone.fingerprint != hm.fingerprint) {
+                    printf("  clone differs\n");
+                    ++num_failed;
+                }
+                int key = 0;
+                hash_map_delete(&clone, &key);
+                if (hash_map_get(&hm, &key, 0)) {
+                    printf("  deleting from the clone changed the original\n");
+                    ++num_failed;
+                }
+                hash_map_destroy(&clone);
+            }
+
+            // A quarter full hash map is copied as it is, and a less full one is rehashed into a smaller one
+            for (int key = NUM_FEATURE_ELEMENTS / 4; key < NUM_FEATURE_ELEMENTS; ++key) {
+                if (key % 1000) {
+                    hash_map_delete(&hm, &key);
+                }
+            }
+            if (hash_map_clone_compact(&compact_clone, &hm)) {
+                printf("  compact clone failed\n");
+                ++num_failed;
+            } else {
+                if (compact_clone.capacity >= hm.capacity || !hash_map_equals(&compact_clone, &hm) ||
+                    compact_clone.fingerprint_enabled != fingerprint || compact_clone.fingerprint != hm.fingerprint ||
+                    compact_clone.num_tombstones) {
+                    printf("  compact clone differs\n");
+                    ++num_failed;
+                }
+                int key = 1, value = 0;
+                hash_map_put(&compact_clone, &key, &value);
+                if (hash_map_get(&hm, &key, &value) || value != value_of(key)) {
+                    printf("  putting in the compact clone changed the original\n");
+                    ++num_failed;
+                }
+                hash_map_destroy(&compact_clone);
+            }
+            hash_map_destroy(&hm);
+        }
+    }
+
+    // The learned model is copied too
+    Hash_Map learned, clone;
+    int *keys = (int *)calloc(NUM_FEATURE_ELEMENTS, sizeof(int));
+    for (int i = 0; i < NUM_FEATURE_ELEMENTS; ++i) {
+        keys[i] = learned_key(i);
+    }
+    if (hash_map_build_learned(&learned, keys, keys, NUM_FEATURE_ELEMENTS, sizeof(int), sizeof(int), 0, 0)) {
+        printf("  learned build failed\n");
+        ++num_failed;
+    } else {
+        if (hash_map_clone(&clone, &learned)) {
+            printf("  learned clone failed\n");
+            ++num_failed;
+        } else {
+            if (!clone.learned_model || clone.learned_model == learned.learned_model || !hash_map_equals(&clone, &learned)) {
+                printf("  learned clone differs\n");
+                ++num_failed;
+            }
+            hash_map_destroy(&clone);
+        }
+        hash_map_destroy(&learned);
+    }
+    free(keys);
+    return num_failed;
+}
+
+// Calculates the fingerprint of the elements of 'hm' from scratch, putting them in a new hash map. Returns 0 if failed.
+static unsigned int fingerprint_from_scratch(Hash_Map *hm) {
+    Hash_Map copy;
+    if (hash_map_create(&copy, 0, sizeof(int), sizeof(int), bench_int_compare, bench_int_hash)) {
+        return 0;
+    }
+    int key, value;
+    Hash_Map_Iterator iterator = hash_map_get_iterator(hm);
+    while ((iterator = hash_map_iterator_next(hm, iterator, &key, &value)) != HASH_MAP_ITERATOR_END) {
+        hash_map_put(&copy, &key, &value);
+    }
+    hash_map_enable_fingerprint(&copy);
+    unsigned int fingerprint = hash_map_get_fingerprint(&copy);
+    hash_map_destroy(&copy);
+    return fingerprint;
+}
+
+// Checks that the fingerprint only depends on the elements, that puts, deletes and the set operations keep it up to date, and
+// that the digests add up to it and tell which range has a difference
+static int check_fingerprint(void) {
+    enum { NUM_RANGES = 64 };
+    int num_failed = 0;
+    Hash_Map a, b, other;
+    // The same elements, put in a different order, with another capacity and another probe sequence
+    if (set_operations_create(&a, 0, NUM_FEATURE_ELEMENTS, 0, HASH_MAP_PROBING_LINEAR) ||
+        set_operations_create(&b, NUM_FEATURE_ELEMENTS / 2, NUM_FEATURE_ELEMENTS * 3 / 2, 1, HASH_MAP_PROBING_LINEAR) ||
+        hash_map_create_with_probing(&other, NUM_FEATURE_ELEMENTS * 4, sizeof(int), sizeof(int), bench_int_compare,
+                                     bench_int_hash, HASH_MAP_PROBING_TRIANGULAR)) {
+        printf("  create failed\n");
+        return 1;
+    }
+    hash_map_enable_fingerprint(&a);
+    hash_map_enable_fingerprint(&other);
+    for (int key = NUM_FEATURE_ELEMENTS - 1; key >= 0; --key) {
+        int value = value_of(key);
+        hash_map_put(&other, &key, &value);
+    }
+    if (hash_map_get_fingerprint(&a) != hash_map_get_fingerprint(&other) ||
+        hash_map_get_fingerprint(&a) != fingerprint_from_scratch(&a)) {
+        printf("  equal hash maps have different fingerprints\n");
+        ++num_failed;
+    }
+
+    // A changed value is only in the range of its key
+    unsigned int digests[NUM_RANGES], other_digests[NUM_RANGES];
+    int key = NUM_FEATURE_ELEMENTS / 3, value = 0;
+    hash_map_put(&other, &key, &value);
+    hash_map_get_digests(&a, digests, NUM_RANGES);
+    hash_map_get_digests(&other, other_digests, NUM_RANGES);
+    unsigned int sum = 0;
+    for (int range = 0; range < NUM_RANGES; ++range) {
+        sum += digests[range];
+        if ((digests[range] != other_digests[range]) != (range == hash_map_get_digest_range(&a, &key, NUM_RANGES))) {
+            printf("  digest of range %d is wrong\n", range);
+            ++num_failed;
+        }
+    }
+    if (sum != hash_map_get_fingerprint(&a) || hash_map_get_fingerprint(&a) == hash_map_get_fingerprint(&other)) {
+        printf("  digests do not add up to the fingerprint\n");
+        ++num_failed;
+    }
+    // Putting the value back, or deleting and putting it, gives the original fingerprint again
+    value = value_of(key);
+    hash_map_put(&other, &key, &value);
+    hash_map_delete(&other, &key);
+    hash_map_put(&other, &key, &value);
+    if (hash_map_get_fingerprint(&a) != hash_map_get_fingerprint(&other)) {
+        printf("  fingerprint after restoring an element differs\n");
+        ++num_failed;
+    }
+    // Not positive numbers of ranges are ignored
+    digests[0] = 1;
+    hash_map_get_digests(&a, digests, 0);
+    if (digests[0] != 1 || hash_map_get_digest_range(&a, &key, 0) != -1 || hash_map_get_digest_range(&a, &key, -1) != -1) {
+        printf("  digests of no ranges failed\n");
+        ++num_failed;
+    }
+
+    // The set operations keep the fingerprint up to date
+    hash_map_merge(&other, &b, set_operations_add);
+    if (hash_map_get_fingerprint(&other) != fingerprint_from_scratch(&other)) {
+        printf("  fingerprint after merge differs\n");
+        ++num_failed;
+    }
+    hash_map_intersect(&other, &a, set_operations_add);
+    if (hash_map_get_fingerprint(&other) != fingerprint_from_scratch(&other)) {
+        printf("  fingerprint after intersect differs\n");
+        ++num_failed;
+    }
+    hash_map_subtract(&other, &b);
+    if (hash_map_get_fingerprint(&other) != fingerprint_from_scratch(&other)) {
+        printf("  fingerprint after subtract differs\n");
+        ++num_failed;
+    }
+    hash_map_destroy(&a);
+    hash_map_destroy(&b);
+    hash_map_destroy(&other);
+    return num_failed;
+}
+
+// Writes 'size' bytes to CHECK_FILE. Returns 0 if success, -1 otherwise.
+static int write_check_file(const void *data, long long size) {
+    FILE *file = fopen(CHECK_FILE, "wb");
+    if (!file) {
+        return -1;
+    }
+    int result = fwrite(data, 1, (size_t)size, file) == (size_t)size ? 0 : -1;
+    return fclose(file) || result ? -1 : 0;
+}
+
+// Bulk loads records (with repeated keys, which must keep the last value) into empty and non-empty hash maps, with both
+// probe sequences and hash functions and several threads, from memory and from a file
+static int check_bulk_load(void) {
+    // Each record is a key and its value. The keys are shuffled, and the last records repeat the multiples of 3 below
+    // 'num_repeated' * 3 with other values.
+    int num_repeated = NUM_FEATURE_ELEMENTS / 10;
+    int num_records = NUM_FEATURE_ELEMENTS + num_repeated;
+    long long records_size = (long long)num_records * 2 * sizeof(int);
+    int *records = (int *)calloc((long long)num_records * 2 + 1, sizeof(int));
+    for (int i = 0; i < NUM_FEATURE_ELEMENTS; ++i) {
+        records[2 * i] = (int)((long long)i * 7919 % NUM_FEATURE_ELEMENTS);
+        records[2 * i + 1] = value_of(records[2 * i]);
+    }
+    for (int i = 0; i < num_repeated; ++i) {
+        records[2 * (NUM_FEATURE_ELEMENTS + i)] = i * 3;
+        records[2 * (NUM_FEATURE_ELEMENTS + i) + 1] = -i * 3;
+    }
+    int num_failed = 0;
+    for (int probing = HASH_MAP_PROBING_LINEAR; probing <= HASH_MAP_PROBING_TRIANGULAR; ++probing) {
+        for (int clustered = 0; clustered < 2; ++clustered) {
+            for (int num_threads = 1; num_threads <= 4; num_threads += 3) {
+                for (int prefilled = 0; prefilled < 2; ++prefilled) {
+                    Hash_Map hm;
+                    if (hash_map_create_with_probing(&hm, 0, sizeof(int), sizeof(int), bench_int_compare,
+                                                     clustered ? bench_clustered_int_hash : bench_int_hash,
+                                                     (Hash_Map_Probing)probing)) {
+                        printf("  create failed\n");
+                        ++num_failed;
+                        continue;
+                    }
+                    // Elements put before the bulk load are either replaced or kept
+                    for (int key = prefilled ? -1000 : 0; key < (prefilled ? 1000 : 0); ++key) {
+                        int value = 0;
+                        hash_map_put(&hm, &key, &value);
+                    }
+                    if (hash_map_bulk_load(&hm, records, num_records, num_threads)) {
+                        printf("  bulk load failed\n");
+                        ++num_failed;
+                    }
+                    for (int key = -1000; key < NUM_FEATURE_ELEMENTS; ++key) {
+                        int value, expected_value = key % 3 == 0 && key < num_repeated * 3 ? -key : value_of(key);
+                        int found = !hash_map_get(&hm, &key, &value);
+                        if (key < 0 ? found != prefilled || (found && value) : !found || value != expected_value) {
+                            printf("  get %d after the bulk load failed\n", key);
+                            ++num_failed;
+                        }
+                    }
+                    if (hm.num_elements != NUM_FEATURE_ELEMENTS + (prefilled ? 1000 : 0)) {
+                        printf("  bulk load left %d elements\n", hm.num_elements);
+                        ++num_failed;
+                    }
+                    hash_map_destroy(&hm);
+                }
+            }
+        }
+    }
+
+    // The same records from a file, which is rejected if it has a partial record
+    Hash_Map hm, from_file;
+    if (hash_map_create(&hm, 0, sizeof(int), sizeof(int), bench_int_compare, bench_int_hash) ||
+        hash_map_create(&from_file, 0, sizeof(int), sizeof(int), bench_int_compare, bench_int_hash)) {
+        printf("  create failed\n");
+        free(records);
+        return num_failed + 1;
+    }
+    hash_map_bulk_load(&hm, records, num_records, 4);
+    if (write_check_file(records, records_size) || hash_map_bulk_load_file(&from_file, CHECK_FILE, 4) ||
+        !hash_map_equals(&hm, &from_file)) {
+        printf("  bulk load from a file failed\n");
+        ++num_failed;
+    }
+    if (write_check_file(records, records_size + 1) || !hash_map_bulk_load_file(&from_file, CHECK_FILE, 4)) {
+        printf("  bulk load from a file with a partial record did not fail\n");
+        ++num_failed;
+    }
+    remove(CHECK_FILE);
+    hash_map_destroy(&hm);
+    hash_map_destroy(&from_file);
+    free(records);
+    return num_failed;
+}
+
+// Whether the file system of the current directory accepts O_DIRECT, which some (such as tmpfs) do not
+static int direct_io_supported(void) {
+#if defined(O_DIRECT)
+    int fd = open(CHECK_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd >= 0) {
+        close(fd);
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+// Flips a byte of CHECK_FILE. Returns 0 if success, -1 otherwise.
+static int corrupt_check_file(long long offset) {
+    FILE *file = fopen(CHECK_FILE, "r+b");
+    if (!file) {
+        return -1;
+    }
+    int byte = fseek(file, (long)offset, SEEK_SET) ? EOF : fgetc(file);
+    int result = byte == EOF || fseek(file, (long)offset, SEEK_SET) || fputc(byte ^ 0x5a, file) == EOF ? -1 : 0;
+    return fclose(file) || result ? -1 : 0;
+}
+
+// Builds the hash maps saved by the snapshot checks: with linear probing, with triangular probing and tombstones (bigger
+// than a chunk, with the fingerprint enabled), and with learned placement
+static int snapshot_create(Hash_Map *hm, int kind) {
+    if (kind == 2) {
+        int *keys = (int *)calloc(NUM_FEATURE_ELEMENTS, sizeof(int));
+        for (int i = 0; i < NUM_FEATURE_ELEMENTS; ++i) {
+            keys[i] = learned_key(i);
+        }
+        int result = hash_map_build_learned(hm, keys, keys, NUM_FEATURE_ELEMENTS, sizeof(int), sizeof(int), bench_int_compare,
+                                            bench_int_hash);
+        free(keys);
+        return result;
+    }
+    if (set_operations_create(hm, 0, NUM_FEATURE_ELEMENTS, 0, kind ? HASH_MAP_PROBING_TRIANGULAR : HASH_MAP_PROBING_LINEAR)) {
+        return -1;
+    }
+    if (kind) {
+        hash_map_enable_fingerprint(hm);
+        for (int key = 0; key < NUM_FEATURE_ELEMENTS; key += 4) {
+            hash_map_delete(hm, &key);
+        }
+    }
+    return 0;
+}
+
+// Checks that 'loaded' is the same as 'hm', with the same layout, tombstones, fingerprint and learned model
+static int snapshot_is_same(Hash_Map *loaded, Hash_Map *hm) {
+    return loaded->capacity == hm->capacity && loaded->probing == hm->probing && loaded->num_tombstones == hm->num_tombstones &&
+           loaded->fingerprint_enabled == hm->fingerprint_enabled && loaded->fingerprint == hm->fingerprint &&
+           !loaded->learned_model == !hm->learned_model && hash_map_equals(loaded, hm);
+}
+
+// Saves and loads several hash maps, with and without O_DIRECT, and checks that corrupted and truncated snapshots are
+// rejected. With C_FEK_HASH_MAP_IO_URING, the snapshots are transferred through io_uring.
+static int check_snapshot(void) {
+    int num_failed = 0;
+    int num_flags = direct_io_supported() ? 2 : 1;
+    for (int kind = 0; kind < 3; ++kind) {
+        Hash_Map hm, loaded;
+        if (snapshot_create(&hm, kind)) {
+            printf("  create failed\n");
+            ++num_failed;
+            continue;
+        }
+        for (int flags = 0; flags < num_flags; ++flags) {
+            if (hash_map_save(&hm, CHECK_FILE, flags) ||
+                hash_map_load(&loaded, CHECK_FILE, flags, bench_int_compare, bench_int_hash)) {
+                printf("  save and load of hash map %d with flags %d failed\n", kind, flags);
+                ++num_failed;
+                continue;
+            }
+            if (!snapshot_is_same(&loaded, &hm)) {
+                printf("  loaded hash map %d with flags %d differs\n", kind, flags);
+                ++num_failed;
+            }
+            // The loaded hash map is usable as any other
+            int key = -1, value = 1;
+            if (hash_map_put(&loaded, &key, &value) || hash_map_get(&loaded, &key, &value) || value != 1) {
+                printf("  put in loaded hash map %d failed\n", kind);
+                ++num_failed;
+            }
+            hash_map_destroy(&loaded);
+        }
+        // A byte flipped in the header or in the middle of the data is detected
+        struct stat file_stat;
+        if (stat(CHECK_FILE, &file_stat)) {
+            printf("  snapshot %d is missing\n", kind);
+            ++num_failed;
+        } else {
+            for (long long offset = 8; offset < file_stat.st_size; offset += file_stat.st_size / 2) {
+                if (corrupt_check_file(offset) || !hash_map_load(&loaded, CHECK_FILE, 0, bench_int_compare, bench_int_hash)) {
+                    printf("  corrupted snapshot %d was loaded\n", kind);
+                    ++num_failed;
+                }
+                corrupt_check_file(offset);
+            }
+            // Snapshots saved with O_DIRECT are padded, so a few bytes less might still hold all the data
+            if (truncate(CHECK_FILE, file_stat.st_size / 2) ||
+                !hash_map_load(&loaded, CHECK_FILE, 0, bench_int_compare, bench_int_hash)) {
+                printf("  truncated snapshot %d was loaded\n", kind);
+                ++num_failed;
+            }
+        }
+        hash_map_destroy(&hm);
+    }
+    remove(CHECK_FILE);
+    Hash_Map missing;
+    if (!hash_map_load(&missing, CHECK_FILE, 0, bench_int_compare, bench_int_hash)) {
+        printf("  missing snapshot was loaded\n");
+        ++num_failed;
+    }
+    return num_failed;
+}
+
+// Encodes and decodes the hash maps of the snapshot checks (with negative keys too), with and without integer keys, in memory
+// and through a file, and checks that corrupted and truncated encodings are rejected
+static int check_compact(void) {
+    int num_failed = 0;
+    for (int kind = 0; kind < 3; ++kind) {
+        Hash_Map hm, decoded;
+        if (snapshot_create(&hm, kind)) {
+            printf("  create failed\n");
+            ++num_failed;
+            continue;
+        }
+        for (int key = -1000; key < 0; ++key) {
+            int value = value_of(key);
+            hash_map_put(&hm, &key, &value);
+        }
+        for (int flags = 0; flags <= HASH_MAP_COMPACT_INTEGER_KEYS; ++flags) {
+            void *buffer;
+            long long size;
+            if (hash_map_encode_compact(&hm, flags, &buffer, &size)) {
+                printf("  encode of hash map %d with flags %d failed\n", kind, flags);
+                ++num_failed;
+                continue;
+            }
+            // The decoded hash map is as big as needed, without tombstones, but with the same fingerprint and model
+            for (int num_threads = 1; num_threads <= 4; num_threads += 3) {
+                if (hash_map_decode_compact(&decoded, buffer, size, bench_int_compare, bench_int_hash, num_threads)) {
+                    printf("  decode of hash map %d with flags %d failed\n", kind, flags);
+                    ++num_failed;
+                    continue;
+                }
+                if (!hash_map_equals(&decoded, &hm) || decoded.num_tombstones || decoded.probing != hm.probing ||
+                    decoded.fingerprint_enabled != hm.fingerprint_enabled || decoded.fingerprint != hm.fingerprint ||
+                    !decoded.learned_model != !hm.learned_model) {
+                    printf("  decoded hash map %d with flags %d differs\n", kind, flags);
+                    ++num_failed;
+                }
+                hash_map_destroy(&decoded);
+            }
+            for (long long offset = 8; offset < size; offset += size / 7) {
+                ((unsigned char *)buffer)[offset] ^= 0x5a;
+                if (!hash_map_decode_compact(&decoded, buffer, size, bench_int_compare, bench_int_hash, 1)) {
+                    printf("  corrupted encoding of hash map %d at %lld was decoded\n", kind, offset);
+                    ++num_failed;
+                    hash_map_destroy(&decoded);
+                }
+                ((unsigned char *)buffer)[offset] ^= 0x5a;
+            }
+            if (!hash_map_decode_compact(&decoded, buffer, size - 1, bench_int_compare, bench_int_hash, 1)) {
+                printf("  truncated encoding of hash map %d was decoded\n", kind);
+                ++num_failed;
+                hash_map_destroy(&decoded);
+            }
+            free(buffer);
+
+            if (hash_map_save_compact(&hm, CHECK_FILE, flags) ||
+                hash_map_load_compact(&decoded, CHECK_FILE, bench_int_compare, bench_int_hash, 4)) {
+                printf("  save and load of hash map %d with flags %d failed\n", kind, flags);
+                ++num_failed;
+            } else {
+                if (!hash_map_equals(&decoded, &hm) || decoded.fingerprint_enabled != hm.fingerprint_enabled ||
+                    decoded.fingerprint != hm.fingerprint) {
+                    printf("  loaded hash map %d with flags %d differs\n", kind, flags);
+                    ++num_failed;
+                }
+                hash_map_destroy(&decoded);
+            }
+        }
+        hash_map_destroy(&hm);
+    }
+    remove(CHECK_FILE);
+
+    // Integer keys must have the size of an integer type
+    Hash_Map odd_keys;
+    void *buffer;
+    long long size;
+    if (hash_map_create(&odd_keys, 0, 3, sizeof(int), bench_int_compare, bench_int_hash) ||
+        !hash_map_encode_compact(&odd_keys, HASH_MAP_COMPACT_INTEGER_KEYS, &buffer, &size)) {
+        printf("  integer keys of 3 bytes were encoded\n");
+        ++num_failed;
+    }
+    hash_map_destroy(&odd_keys);
+    return num_failed;
+}
+
+// Maps the snapshots of the snapshot checks, verifies them, changes them (until they grow out of the mapping) without
+// changing the files, and checks that corrupted snapshots fail to verify
+static int check_load_mapped(void) {
+    int num_failed = 0;
+    for (int kind = 0; kind < 3; ++kind) {
+        Hash_Map hm, mapped, loaded;
+        if (snapshot_create(&hm, kind) || hash_map_save(&hm, CHECK_FILE, 0)) {
+            printf("  create and save failed\n");
+            ++num_failed;
+            continue;
+        }
+        if (hash_map_load_mapped(&mapped, CHECK_FILE, bench_int_compare, bench_int_hash)) {
+            printf("  mapping snapshot %d failed\n", kind);
+            ++num_failed;
+            hash_map_destroy(&hm);
+            continue;
+        }
+        if (!snapshot_is_same(&mapped, &hm) || hash_map_verify_mapped(&mapped)) {
+            printf("  mapped snapshot %d differs\n", kind);
+            ++num_failed;
+        }
+        // Deletes and puts change the mapped memory, and enough puts make the hash map grow into its own memory. The new keys
+        // are within the range of the learned model, and the same changes are made to a clone of the original hash map.
+        Hash_Map expected;
+        if (hash_map_clone(&expected, &hm)) {
+            printf("  clone failed\n");
+            ++num_failed;
+            hash_map_destroy(&mapped);
+            hash_map_destroy(&hm);
+            continue;
+        }
+        for (int key = 0; key < NUM_FEATURE_ELEMENTS; key += 2) {
+            hash_map_delete(&mapped, &key);
+            hash_map_delete(&expected, &key);
+        }
+        for (int i = 0; i < NUM_FEATURE_ELEMENTS; ++i) {
+            int key = learned_key(i) + 1, value = value_of(key);
+            hash_map_put(&mapped, &key, &value);
+            hash_map_put(&expected, &key, &value);
+        }
+        if (!hash_map_equals(&mapped, &expected)) {
+            printf("  changed mapped snapshot %d differs\n", kind);
+            ++num_failed;
+        }
+        hash_map_destroy(&expected);
+        if (mapped.mapping) {
+            printf("  mapped snapshot %d did not grow out of the mapping\n", kind);
+            ++num_failed;
+        }
+        hash_map_destroy(&mapped);
+        if (hash_map_load(&loaded, CHECK_FILE, 0, bench_int_compare, bench_int_hash) || !snapshot_is_same(&loaded, &hm)) {
+            printf("  changing mapped snapshot %d changed the file\n", kind);
+            ++num_failed;
+        } else {
+            hash_map_destroy(&loaded);
+        }
+        // The checksum is only verified on request
+        struct stat file_stat;
+        if (stat(CHECK_FILE, &file_stat) || corrupt_check_file(file_stat.st_size - 1) ||
+            hash_map_load_mapped(&mapped, CHECK_FILE, bench_int_compare, bench_int_hash)) {
+            printf("  mapping corrupted snapshot %d failed\n", kind);
+            ++num_failed;
+        } else {
+            if (!hash_map_verify_mapped(&mapped)) {
+                printf("  corrupted snapshot %d was verified\n", kind);
+                ++num_failed;
+            }
+            hash_map_destroy(&mapped);
+        }
+        if (!hash_map_verify_mapped(&hm)) {
+            printf("  hash map %d, which is not mapped, was verified\n", kind);
+            ++num_failed;
+        }
+        hash_map_destroy(&hm);
+    }
+    remove(CHECK_FILE);
+    return num_failed;
+}
+
+// Checks that the replicas are the same as the hash map they were created from, that they don't change until the changes
+// are published (with and without growing), and that interleaving keeps a hash map usable. On single-node machines there
+// is a single replica and interleaving does nothing.
+static int check_replicas(void) {
+    int num_failed = 0;
+    if (hash_map_get_num_numa_nodes() < 1 || hash_map_get_num_numa_nodes() > HASH_MAP_MAX_NUMA_NODES) {
+        printf("  %d NUMA nodes\n", hash_map_get_num_numa_nodes());
+        ++num_failed;
+    }
+    for (int kind = 0; kind < 3; ++kind) {
+        Hash_Map hm;
+        Hash_Map_Replicas hmr;
+        if (snapshot_create(&hm, kind)) {
+            printf("  create failed\n");
+            ++num_failed;
+            continue;
+        }
+        if (hash_map_replicas_create(&hmr, &hm)) {
+            printf("  creating the replicas of hash map %d failed\n", kind);
+            ++num_failed;
+            hash_map_destroy(&hm);
+            continue;
+        }
+        for (int step = 0; step < 3; ++step) {
+            int num_different = 0;
+            for (int replica = 0; replica < hmr.num_replicas; ++replica) {
+                num_different += !snapshot_is_same(&hmr.replicas[replica], &hm);
+            }
+            Hash_Map *read = hash_map_replicas_get(&hmr);
+            if (num_different || hmr.num_replicas < 1 || hmr.num_replicas > hash_map_get_num_numa_nodes() || !read ||
+                read < hmr.replicas || read >= hmr.replicas + hmr.num_replicas) {
+                printf("  replicas of hash map %d differ after step %d\n", kind, step);
+                ++num_failed;
+            }
+            if (step == 2) {
+                break;
+            }
+            // First without growing, then growing, with keys within the range of the learned model
+            for (int i = 0; i < NUM_FEATURE_ELEMENTS; i += 3) {
+                int key = learned_key(i);
+                hash_map_delete(&hm, &key);
+            }
+            int capacity = hm.capacity;
+            if (step) {
+                for (int i = 0; i < NUM_FEATURE_ELEMENTS; ++i) {
+                    int key = learned_key(i) + 1, value = value_of(key);
+                    hash_map_put(&hm, &key, &value);
+                }
+            }
+            if ((hm.capacity != capacity) != step || hash_map_equals(&hmr.replicas[0], &hm)) {
+                printf("  replicas of hash map %d changed before step %d was published\n", kind, step);
+                ++num_failed;
+            }
+            if (hash_map_replicas_publish(&hmr, &hm)) {
+                printf("  publishing step %d to the replicas of hash map %d failed\n", step, kind);
+                ++num_failed;
+            }
+        }
+        hash_map_replicas_destroy(&hmr);
+        Hash_Map interleaved;
+        if (hash_map_clone(&interleaved, &hm) || hash_map_interleave(&interleaved)) {
+            printf("  interleaving hash map %d failed\n", kind);
+            ++num_failed;
+            hash_map_destroy(&hm);
+            continue;
+        }
+        for (int key = -1; key >= -1000; --key) {
+            int value = value_of(key);
+            hash_map_put(&interleaved, &key, &value);
+            hash_map_put(&hm, &key, &value);
+        }
+        if (!hash_map_equals(&interleaved, &hm)) {
+            printf("  interleaved hash map %d differs\n", kind);
+            ++num_failed;
+        }
+        hash_map_destroy(&interleaved);
+        hash_map_destroy(&hm);
+    }
+    return num_failed;
+}
+
+// The checks of the other features. Each returns the number of failed checks.
+static const struct {
+    const char *name;
+    int (*check)(void);
+} feature_checks[] = {
+    {"interner", check_interner},
+    {"composite keys", check_key_schema},
+    {"learned placement", check_learned},
+    {"set operations", check_set_operations},
+    {"clone", check_clone},
+    {"fingerprint", check_fingerprint},
+    {"bulk load", check_bulk_load},
+    {"snapshots", check_snapshot},
+    {"compact snapshots", check_compact},
+    {"mapped snapshots", check_load_mapped},
+    {"NUMA replicas", check_replicas},
+};
+
+int main(int argc, char **argv) {
+    int max_initial_capacity = (int)bench_arg(argc, argv, 1, 1 << 20);
+    int num_failed = 0;
+    for (int type = 0; type < NUM_MAP_TYPES; ++type) {
+        for (int clustered = 0; clustered < 2; ++clustered) {
+            // Clusters of 8 keys fill both buckets of their hash in a cuckoo map, which can't hold them (check
+            // 'hash_map_cuckoo_create')
+            if (clustered && type == MAP_CUCKOO) {
+                continue;
+            }
+            for (int initial_capacity = 0; initial_capacity <= max_initial_capacity;
+                 initial_capacity = initial_capacity ? initial_capacity * 16 : 16) {
+                printf("%-18s %-9s initial capacity %d\n", map_type_names[type], clustered ? "clustered" : "random",
+                       initial_capacity);
+                num_failed += check_map((Map_Type)type, initial_capacity, clustered ? bench_clustered_int_hash : bench_int_hash);
+            }
+        }
+    }
+    for (int i = 0; i < (int)(sizeof(feature_checks) / sizeof(feature_checks[0])); ++i) {
+        printf("%s\n", feature_checks[i].name);
+        num_failed += feature_checks[i].check();
+    }
+    printf("%s\n", num_failed ? "FAILED" : "OK");
+    return num_failed ? 1 : 0;
+}
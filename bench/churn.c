@@ -0,0 +1,111 @@
+// Steady-state insert/delete churn.
+//
+// The hash map is filled to a load factor and then every step deletes one element and inserts a new one, so the number of
+// elements stays the same. The steps are split in intervals, and the throughput of each interval is reported, to show
+// whether the performance degrades as the clusters evolve. With linear probing, the average and maximum number of elements
+// rehashed and moved by each backward shift are reported too (from 'hash_map_get_shift_stats'). With triangular probing,
+// deletes leave tombstones instead, and the number of grows (rehashes to clear them) is reported.
+// The key distributions are:
+//   random:    unique keys in random order, and a random element is deleted
+//   fifo:      sequential keys, and the oldest element is deleted (a sliding window)
+//   clustered: sequential keys, with groups of 8 keys hashed to the same slot, and a random element is deleted
+// The instrumentation is enabled to get the shift stats, so the throughput includes its overhead.
+//
+// Usage: churn [capacity] [steps_per_interval] [num_intervals]
+
+#define C_FEK_HASH_MAP_IMPLEMENT
+#define C_FEK_HASH_MAP_INSTRUMENT
+#include "../hash_map.h"
+#include "bench.h"
+
+typedef enum { KEYS_RANDOM, KEYS_FIFO, KEYS_CLUSTERED, NUM_KEY_DISTRIBUTIONS } Key_Distribution;
+
+static const char *key_distribution_names[NUM_KEY_DISTRIBUTIONS] = {"random", "fifo", "clustered"};
+static const double load_factors[] = {0.25, 0.35, 0.45};
+
+#define NUM_LOAD_FACTORS ((int)(sizeof(load_factors) / sizeof(load_factors[0])))
+
+static void on_event(Hash_Map *hm, Hash_Map_Event event, long long detail, void *user_data) {
+    (void)hm;
+    (void)detail;
+    if (event == HASH_MAP_EVENT_GROW_START) {
+        ++*(int *)user_data;
+    }
+}
+
+// Scrambles a counter into a unique key (both steps are invertible)
+static int make_key(Key_Distribution distribution, unsigned int counter) {
+    if (distribution != KEYS_RANDOM) {
+        return (int)counter;
+    }
+    counter *= 0x85ebca6bu;
+    return (int)(counter ^ (counter >> 13));
+}
+
+int main(int argc, char **argv) {
+    int capacity = (int)bench_arg(argc, argv, 1, 1 << 20);
+    int steps_per_interval = (int)bench_arg(argc, argv, 2, 200000);
+    int num_intervals = (int)bench_arg(argc, argv, 3, 10);
+    int num_grows = 0;
+    hash_map_set_event_func(on_event, &num_grows, 0);
+    printf("capacity %d, %d intervals of %d steps (a delete and an insert), throughput in million steps per second\n\n",
+           capacity, num_intervals, steps_per_interval);
+    printf("%-10s %-10s %5s | %-*s | %9s %5s %9s %5s %5s\n", "probing", "keys", "load", 6 * num_intervals - 1,
+           "throughput over time", "moved/del", "max", "rehash/del", "max", "grows");
+
+    for (int probing = 0; probing < 2; ++probing) {
+        for (int distribution = 0; distribution < NUM_KEY_DISTRIBUTIONS; ++distribution) {
+            for (int load = 0; load < NUM_LOAD_FACTORS; ++load) {
+                Hash_Map hm;
+                Key_Hash_Func key_hash_func = distribution == KEYS_CLUSTERED ? bench_clustered_int_hash : bench_int_hash;
+                if (hash_map_create_with_probing(&hm, capacity, sizeof(int), sizeof(int), bench_int_compare, key_hash_func,
+                                                 probing ? HASH_MAP_PROBING_TRIANGULAR : HASH_MAP_PROBING_LINEAR)) {
+                    return 1;
+                }
+                // The live keys, as a ring: the oldest one is at 'oldest'
+                int num_keys = (int)(load_factors[load] * hm.capacity);
+                int *keys = (int *)malloc(sizeof(int) * (num_keys > 0 ? num_keys : 1));
+                unsigned int counter = 0;
+                int oldest = 0;
+                unsigned long long random_state = 42;
+                for (int i = 0; i < num_keys; ++i) {
+                    keys[i] = make_key((Key_Distribution)distribution, counter++);
+                    hash_map_put(&hm, &keys[i], &i);
+                }
+                num_grows = 0;
+                Hash_Map_Shift_Stats stats, total_stats = {0, 0, 0, 0, 0};
+                printf("%-10s %-10s %5.2f |", probing ? "triangular" : "linear", key_distribution_names[distribution],
+                       load_factors[load]);
+                for (int interval = 0; interval < num_intervals && num_keys > 0; ++interval) {
+                    hash_map_reset_shift_stats();
+                    long long start = bench_now();
+                    for (int step = 0; step < steps_per_interval; ++step) {
+                        int index = distribution == KEYS_FIFO ? oldest : (int)(bench_random(&random_state) % num_keys);
+                        hash_map_delete(&hm, &keys[index]);
+                        keys[index] = make_key((Key_Distribution)distribution, counter++);
+                        hash_map_put(&hm, &keys[index], &step);
+                        oldest = (oldest + 1) % num_keys;
+                    }
+                    long long elapsed = bench_now() - start;
+                    printf(" %5.1f", steps_per_interval / (elapsed / 1e3));
+                    fflush(stdout);
+                    hash_map_get_shift_stats(&stats);
+                    total_stats.num_rehashed += stats.num_rehashed;
+                    total_stats.num_moved += stats.num_moved;
+                    total_stats.max_rehashed = stats.max_rehashed > total_stats.max_rehashed ? stats.max_rehashed : total_stats.max_rehashed;
+                    total_stats.max_moved = stats.max_moved > total_stats.max_moved ? stats.max_moved : total_stats.max_moved;
+                }
+                double num_deletes = (double)steps_per_interval * num_intervals;
+                if (probing) {
+                    printf(" | %9s %5s %9s %5s %5d\n", "-", "-", "-", "-", num_grows);
+                } else {
+                    printf(" | %9.2f %5llu %9.2f %5llu %5d\n", total_stats.num_moved / num_deletes, total_stats.max_moved,
+                           total_stats.num_rehashed / num_deletes, total_stats.max_rehashed, num_grows);
+                }
+                free(keys);
+                hash_map_destroy(&hm);
+            }
+        }
+    }
+    return 0;
+}
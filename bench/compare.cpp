@@ -0,0 +1,234 @@
+// Compares hash_map.h with std::unordered_map and with a reference open-addressing map (flat_map.hpp) on the same workloads.
+//
+// For each size, every map gets the same shuffled 64-bit keys and 64-bit values, with the same hash function, and is
+// measured on:
+//   insert:   putting all keys into an empty map, which grows as needed
+//   hit:      getting every key, in a different order
+//   miss:     getting keys that are not in the map
+//   delete:   deleting every key
+//   bytes:    memory allocated per element after the inserts (std::unordered_map and the reference map are measured with a
+//             counting allocator, hash_map.h with 'hash_map_memory_usage')
+// Small sizes are repeated, so every measurement covers at least a few million operations. The results are printed as a
+// table, and as CSV to the file given as the second argument (plot it with 'gnuplot -c compare.gp compare.csv').
+//
+// Usage: compare [max_size] [csv_file]
+
+#define C_FEK_HASH_MAP_IMPLEMENT
+#include "../hash_map.h"
+#include "bench.h"
+#include "flat_map.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+static long long allocated_bytes;
+
+// Counts the bytes allocated by the standard containers
+template <typename T>
+struct Counting_Allocator {
+    typedef T value_type;
+    Counting_Allocator() {
+    }
+    template <typename U>
+    Counting_Allocator(const Counting_Allocator<U> &) {
+    }
+    T *allocate(std::size_t n) {
+        allocated_bytes += (long long)(n * sizeof(T));
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+    void deallocate(T *p, std::size_t n) {
+        allocated_bytes -= (long long)(n * sizeof(T));
+        ::operator delete(p);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const Counting_Allocator<T> &, const Counting_Allocator<U> &) {
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const Counting_Allocator<T> &, const Counting_Allocator<U> &) {
+    return false;
+}
+
+static std::uint64_t mix_key(std::uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    return key;
+}
+
+struct Key_Hash {
+    std::size_t operator()(std::uint64_t key) const {
+        return (std::size_t)mix_key(key);
+    }
+};
+
+static int key_compare(const void *key1, const void *key2) {
+    return *(const std::uint64_t *)key1 == *(const std::uint64_t *)key2;
+}
+
+static unsigned int key_hash(const void *key) {
+    return (unsigned int)mix_key(*(const std::uint64_t *)key);
+}
+
+enum Workload { INSERT, HIT, MISS, DELETE, NUM_WORKLOADS };
+
+struct Result {
+    double ns_per_op[NUM_WORKLOADS];
+    double bytes_per_element;
+    std::uint64_t checksum;
+};
+
+// The operations of each map, so all maps run the same workload code
+struct Hash_Map_Adapter {
+    Hash_Map hm;
+    explicit Hash_Map_Adapter(Hash_Map_Probing probing) {
+        hash_map_create_with_probing(&hm, 16, sizeof(std::uint64_t), sizeof(std::uint64_t), key_compare, key_hash, probing);
+    }
+    ~Hash_Map_Adapter() {
+        hash_map_destroy(&hm);
+    }
+    void put(std::uint64_t key, std::uint64_t value) {
+        hash_map_put(&hm, &key, &value);
+    }
+    std::uint64_t get(std::uint64_t key) {
+        std::uint64_t value = 0;
+        hash_map_get(&hm, &key, &value);
+        return value;
+    }
+    void erase(std::uint64_t key) {
+        hash_map_delete(&hm, &key);
+    }
+    long long bytes() {
+        return hash_map_memory_usage(&hm).allocated_bytes;
+    }
+};
+
+struct Unordered_Map_Adapter {
+    std::unordered_map<std::uint64_t, std::uint64_t, Key_Hash, std::equal_to<std::uint64_t>,
+                       Counting_Allocator<std::pair<const std::uint64_t, std::uint64_t>>>
+        map;
+    void put(std::uint64_t key, std::uint64_t value) {
+        map[key] = value;
+    }
+    std::uint64_t get(std::uint64_t key) {
+        auto it = map.find(key);
+        return it == map.end() ? 0 : it->second;
+    }
+    void erase(std::uint64_t key) {
+        map.erase(key);
+    }
+    long long bytes() {
+        return allocated_bytes;
+    }
+};
+
+struct Flat_Map_Adapter {
+    Flat_Map<std::uint64_t, std::uint64_t, Key_Hash, Counting_Allocator<char>> map;
+    void put(std::uint64_t key, std::uint64_t value) {
+        map.put(key, value);
+    }
+    std::uint64_t get(std::uint64_t key) {
+        const std::uint64_t *value = map.get(key);
+        return value ? *value : 0;
+    }
+    void erase(std::uint64_t key) {
+        map.erase(key);
+    }
+    long long bytes() {
+        return allocated_bytes;
+    }
+};
+
+template <typename Make_Map>
+static Result run(Make_Map make_map, const std::vector<std::uint64_t> &keys, const std::vector<std::uint64_t> &lookup_keys,
+                  const std::vector<std::uint64_t> &missing_keys, int repetitions) {
+    Result result = Result();
+    long long elapsed[NUM_WORKLOADS] = {0, 0, 0, 0};
+    for (int repetition = 0; repetition < repetitions; ++repetition) {
+        allocated_bytes = 0;
+        auto map = make_map();
+        long long start = bench_now();
+        for (std::uint64_t key : keys) {
+            map->put(key, key + 1);
+        }
+        elapsed[INSERT] += bench_now() - start;
+        result.bytes_per_element = (double)map->bytes() / keys.size();
+        start = bench_now();
+        for (std::uint64_t key : lookup_keys) {
+            result.checksum += map->get(key);
+        }
+        elapsed[HIT] += bench_now() - start;
+        start = bench_now();
+        for (std::uint64_t key : missing_keys) {
+            result.checksum += map->get(key);
+        }
+        elapsed[MISS] += bench_now() - start;
+        start = bench_now();
+        for (std::uint64_t key : keys) {
+            map->erase(key);
+        }
+        elapsed[DELETE] += bench_now() - start;
+        delete map;
+    }
+    for (int workload = 0; workload < NUM_WORKLOADS; ++workload) {
+        result.ns_per_op[workload] = (double)elapsed[workload] / ((double)keys.size() * repetitions);
+    }
+    return result;
+}
+
+int main(int argc, char **argv) {
+    long long max_size = bench_arg(argc, argv, 1, 1000000);
+    FILE *csv = argc > 2 ? fopen(argv[2], "w") : 0;
+    static const char *map_names[] = {"hash_map.h (linear)", "hash_map.h (triangular)", "std::unordered_map", "reference flat map"};
+    // Names without spaces, for the CSV
+    static const char *map_ids[] = {"hash_map_linear", "hash_map_triangular", "std_unordered_map", "flat_map"};
+    const int num_maps = 4;
+    if (csv) {
+        fprintf(csv, "map,size,insert_ns,hit_ns,miss_ns,delete_ns,bytes_per_element\n");
+    }
+    printf("%-24s %10s %10s %10s %10s %10s %10s\n", "map", "size", "insert ns", "hit ns", "miss ns", "delete ns", "bytes/elem");
+    unsigned long long random_state = 1;
+    for (long long size = 1000; size <= max_size; size *= 10) {
+        std::vector<std::uint64_t> keys(size), missing_keys(size);
+        for (long long i = 0; i < size; ++i) {
+            keys[i] = bench_random(&random_state) | 1;
+            // Even keys are never inserted
+            missing_keys[i] = bench_random(&random_state) & ~1ull;
+        }
+        std::vector<std::uint64_t> lookup_keys(keys);
+        for (long long i = size - 1; i > 0; --i) {
+            std::swap(lookup_keys[i], lookup_keys[bench_random(&random_state) % (i + 1)]);
+        }
+        int repetitions = (int)std::max(1ll, 2000000 / size);
+        Result results[4];
+        results[0] = run([] { return new Hash_Map_Adapter(HASH_MAP_PROBING_LINEAR); }, keys, lookup_keys, missing_keys, repetitions);
+        results[1] = run([] { return new Hash_Map_Adapter(HASH_MAP_PROBING_TRIANGULAR); }, keys, lookup_keys, missing_keys,
+                         repetitions);
+        results[2] = run([] { return new Unordered_Map_Adapter(); }, keys, lookup_keys, missing_keys, repetitions);
+        results[3] = run([] { return new Flat_Map_Adapter(); }, keys, lookup_keys, missing_keys, repetitions);
+        for (int map = 0; map < num_maps; ++map) {
+            // Every map must have found the same values
+            if (results[map].checksum != results[0].checksum) {
+                printf("%s returned wrong values\n", map_names[map]);
+                return 1;
+            }
+            const double *ns = results[map].ns_per_op;
+            printf("%-24s %10lld %10.1f %10.1f %10.1f %10.1f %10.1f\n", map_names[map], size, ns[INSERT], ns[HIT], ns[MISS],
+                   ns[DELETE], results[map].bytes_per_element);
+            if (csv) {
+                fprintf(csv, "%s,%lld,%.2f,%.2f,%.2f,%.2f,%.2f\n", map_ids[map], size, ns[INSERT], ns[HIT], ns[MISS], ns[DELETE],
+                        results[map].bytes_per_element);
+            }
+        }
+        printf("\n");
+    }
+    if (csv) {
+        fclose(csv);
+    }
+    return 0;
+}
@@ -0,0 +1,17 @@
+# Plots the CSV written by the compare benchmark: gnuplot -c compare.gp compare.csv
+# Writes compare.png, with one chart per column, against the number of elements.
+set datafile separator ','
+set terminal pngcairo size 1500,900
+set output 'compare.png'
+set logscale x
+set key top left
+set xlabel 'elements'
+maps = 'hash_map_linear hash_map_triangular std_unordered_map flat_map'
+columns = 'insert_ns hit_ns miss_ns delete_ns bytes_per_element'
+titles = "'insert (ns/op)' 'hit (ns/op)' 'miss (ns/op)' 'delete (ns/op)' 'bytes per element'"
+set multiplot layout 2,3
+do for [c = 1:5] {
+    set title word(titles, c)
+    plot for [m in maps] ARG1 using (strcol(1) eq m ? $2 : NaN):(column(c + 2)) with linespoints title m
+}
+unset multiplot
@@ -0,0 +1,104 @@
+// A simple open-addressing hash map, used as a reference by the comparison benchmark. It is the textbook design: a single
+// array of slots with linear probing, a power-of-two capacity, a maximum load of 75% and backward-shift deletes, with the
+// occupancy kept in a separate byte array. It is not meant to be used outside of the benchmarks.
+#ifndef C_FEK_HASH_MAP_BENCH_FLAT_MAP_HPP
+#define C_FEK_HASH_MAP_BENCH_FLAT_MAP_HPP
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+template <typename Key, typename Value, typename Hash, typename Allocator = std::allocator<char>>
+class Flat_Map {
+  public:
+    explicit Flat_Map(std::size_t initial_capacity = 16) {
+        std::size_t capacity = 16;
+        while (capacity < initial_capacity) {
+            capacity <<= 1;
+        }
+        slots_.resize(capacity);
+        used_.resize(capacity);
+    }
+
+    std::size_t size() const {
+        return size_;
+    }
+
+    std::size_t allocated_bytes() const {
+        return slots_.capacity() * sizeof(Slot) + used_.capacity();
+    }
+
+    void put(const Key &key, const Value &value) {
+        if ((size_ + 1) * 4 > slots_.size() * 3) {
+            grow();
+        }
+        std::size_t pos = find_slot(key);
+        if (!used_[pos]) {
+            used_[pos] = 1;
+            slots_[pos].key = key;
+            ++size_;
+        }
+        slots_[pos].value = value;
+    }
+
+    const Value *get(const Key &key) const {
+        std::size_t pos = find_slot(key);
+        return used_[pos] ? &slots_[pos].value : nullptr;
+    }
+
+    bool erase(const Key &key) {
+        std::size_t mask = slots_.size() - 1;
+        std::size_t pos = find_slot(key);
+        if (!used_[pos]) {
+            return false;
+        }
+        // Elements after the gap are moved back into it if their home is not between the gap and themselves
+        for (std::size_t next = (pos + 1) & mask; used_[next]; next = (next + 1) & mask) {
+            std::size_t home = Hash()(slots_[next].key) & mask;
+            if (((next - home) & mask) >= ((next - pos) & mask)) {
+                slots_[pos] = slots_[next];
+                pos = next;
+            }
+        }
+        used_[pos] = 0;
+        --size_;
+        return true;
+    }
+
+  private:
+    struct Slot {
+        Key key;
+        Value value;
+    };
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<Slot> Slot_Allocator;
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<unsigned char> Byte_Allocator;
+
+    std::size_t find_slot(const Key &key) const {
+        std::size_t mask = slots_.size() - 1;
+        std::size_t pos = Hash()(key) & mask;
+        while (used_[pos] && !(slots_[pos].key == key)) {
+            pos = (pos + 1) & mask;
+        }
+        return pos;
+    }
+
+    void grow() {
+        std::vector<Slot, Slot_Allocator> old_slots(slots_.size() * 2);
+        std::vector<unsigned char, Byte_Allocator> old_used(used_.size() * 2);
+        old_slots.swap(slots_);
+        old_used.swap(used_);
+        size_ = 0;
+        for (std::size_t pos = 0; pos < old_slots.size(); ++pos) {
+            if (old_used[pos]) {
+                put(old_slots[pos].key, old_slots[pos].value);
+            }
+        }
+    }
+
+    std::vector<Slot, Slot_Allocator> slots_;
+    std::vector<unsigned char, Byte_Allocator> used_;
+    std::size_t size_ = 0;
+};
+
+#endif
@@ -0,0 +1,126 @@
+// Tail latency of inserts into a growing hash map.
+//
+// Inserts are issued at a fixed rate, as a service receiving requests would, and the latency of each one is recorded. When
+// an insert stalls (for example, on a grow), the inserts that should have been issued meanwhile are not, so their latencies
+// are added by 'hash_map_histogram_record' (coordinated omission correction). Both the corrected and the raw tails are
+// reported, for these modes:
+//   grow:    the default, the hash map doubles inside the put that fills it to half
+//   reserve: the hash map is reserved for all inserts first, so it never grows
+//   linear:  the linear hashing map, which grows by splitting one bucket at a time
+// There is no background grow mode in hash_map.h. The grow events of the first mode are printed as a timeline.
+//
+// Usage: tail_latency [num_inserts] [inserts_per_second]
+
+#define C_FEK_HASH_MAP_IMPLEMENT
+#define C_FEK_HASH_MAP_INSTRUMENT
+#include "../hash_map.h"
+#include "bench.h"
+
+#define MAX_GROW_EVENTS 64
+
+typedef enum { MODE_GROW, MODE_RESERVE, MODE_LINEAR, NUM_MODES } Mode;
+
+static const char *mode_names[NUM_MODES] = {"grow", "reserve", "linear"};
+
+typedef struct {
+    long long time;
+    int insert;
+    long long capacity;
+    long long duration;
+} Grow_Event;
+
+typedef struct {
+    long long start_time;
+    int current_insert;
+    int num_events;
+    Grow_Event events[MAX_GROW_EVENTS];
+} Timeline;
+
+static void on_event(Hash_Map *hm, Hash_Map_Event event, long long detail, void *user_data) {
+    (void)hm;
+    Timeline *timeline = (Timeline *)user_data;
+    if (event == HASH_MAP_EVENT_GROW_START && timeline->num_events < MAX_GROW_EVENTS) {
+        Grow_Event *grow_event = &timeline->events[timeline->num_events];
+        grow_event->time = bench_now();
+        grow_event->insert = timeline->current_insert;
+        grow_event->capacity = detail;
+    } else if (event == HASH_MAP_EVENT_GROW_END && timeline->num_events < MAX_GROW_EVENTS) {
+        Grow_Event *grow_event = &timeline->events[timeline->num_events++];
+        grow_event->duration = bench_now() - grow_event->time;
+        grow_event->time -= timeline->start_time;
+    }
+}
+
+static int insert(Mode mode, Hash_Map *hm, Hash_Map_Linear *hml, int key) {
+    return mode == MODE_LINEAR ? hash_map_linear_put(hml, &key, &key) : hash_map_put(hm, &key, &key);
+}
+
+static void print_row(const char *name, const Hash_Map_Histogram *corrected, const Hash_Map_Histogram *raw) {
+    printf("%-8s %10llu %10llu %10llu %10llu %12llu %12llu\n", name, hash_map_histogram_get_percentile(corrected, 50),
+           hash_map_histogram_get_percentile(corrected, 99), hash_map_histogram_get_percentile(corrected, 99.9),
+           hash_map_histogram_get_percentile(corrected, 99.99), corrected->max_value,
+           hash_map_histogram_get_percentile(raw, 99.99));
+}
+
+int main(int argc, char **argv) {
+    int num_inserts = (int)bench_arg(argc, argv, 1, 2000000);
+    long long rate = bench_arg(argc, argv, 2, 1000000);
+    long long interval = 1000000000ll / (rate > 0 ? rate : 1);
+    static Timeline timeline;
+    static Hash_Map_Histogram corrected[NUM_MODES], raw[NUM_MODES];
+    printf("%d inserts at %lld per second (one every %lld ns), latencies in ns\n\n", num_inserts, rate, interval);
+    hash_map_set_event_func(on_event, &timeline, 0);
+
+    for (int mode = 0; mode < NUM_MODES; ++mode) {
+        Hash_Map hm;
+        Hash_Map_Linear hml;
+        if (mode == MODE_LINEAR) {
+            if (hash_map_linear_create(&hml, 16, sizeof(int), sizeof(int), bench_int_compare, bench_int_hash)) {
+                return 1;
+            }
+        } else if (hash_map_create(&hm, 16, sizeof(int), sizeof(int), bench_int_compare, bench_int_hash) ||
+                   (mode == MODE_RESERVE && hash_map_reserve(&hm, num_inserts))) {
+            return 1;
+        }
+        timeline.num_events = 0;
+        timeline.start_time = bench_now();
+        long long next_time = timeline.start_time;
+        for (int i = 0; i < num_inserts; ++i) {
+            long long start;
+            while ((start = bench_now()) < next_time) {
+            }
+            timeline.current_insert = i;
+            if (insert((Mode)mode, &hm, &hml, i)) {
+                return 1;
+            }
+            long long end = bench_now();
+            hash_map_histogram_record(&corrected[mode], (unsigned long long)(end - start), (unsigned long long)interval);
+            hash_map_histogram_record(&raw[mode], (unsigned long long)(end - start), 0);
+            // After a stall, the next insert is issued right away, and the ones that were missed are never issued
+            next_time += interval;
+            if (next_time < end) {
+                next_time = end;
+            }
+        }
+        if (mode == MODE_GROW) {
+            printf("grow timeline:\n%10s %10s %12s %12s\n", "time (ms)", "insert", "capacity", "duration (us)");
+            for (int i = 0; i < timeline.num_events; ++i) {
+                Grow_Event *grow_event = &timeline.events[i];
+                printf("%10.2f %10d %12lld %12.1f\n", grow_event->time / 1e6, grow_event->insert, grow_event->capacity,
+                       grow_event->duration / 1e3);
+            }
+            printf("\n");
+        }
+        if (mode == MODE_LINEAR) {
+            hash_map_linear_destroy(&hml);
+        } else {
+            hash_map_destroy(&hm);
+        }
+    }
+
+    printf("%-8s %10s %10s %10s %10s %12s %12s\n", "mode", "p50", "p99", "p99.9", "p99.99", "max", "raw p99.99");
+    for (int mode = 0; mode < NUM_MODES; ++mode) {
+        print_row(mode_names[mode], &corrected[mode], &raw[mode]);
+    }
+    return 0;
+}